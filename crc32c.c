@@ -0,0 +1,68 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#define POLY 0x82f63b78
+
+static uint32_t crc_table[256];
+
+static void init_crc_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+    }
+    crc_table[i] = crc;
+  }
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*) data;
+  crc = ~crc;
+  while (len--) {
+    crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*) data;
+  uint64_t crc64 = ~crc & 0xffffffff;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    len -= 8;
+  }
+  uint32_t crc32 = (uint32_t) crc64;
+  while (len--) {
+    crc32 = _mm_crc32_u8(crc32, *p++);
+  }
+  return ~crc32;
+}
+
+#endif
+
+static uint32_t (*crc32c_impl)(uint32_t, const void*, size_t) = NULL;
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+  if (crc32c_impl == NULL) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+      crc32c_impl = crc32c_hw;
+    }
+#endif
+    if (crc32c_impl == NULL) {
+      init_crc_table();
+      crc32c_impl = crc32c_sw;
+    }
+  }
+  return crc32c_impl(crc, data, len);
+}
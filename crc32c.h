@@ -0,0 +1,11 @@
+#ifndef phm_crc32c_h
+#define phm_crc32c_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it
+// and a table-driven fallback otherwise; both give identical results.
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+#endif
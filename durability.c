@@ -0,0 +1,241 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "table.h"
+#include "internal.h"
+
+void mark_dirty(phm_table* table, const void* addr, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  if (table->snapshot != NULL) {
+    preserve_snapshot(table, addr, len);
+  }
+  if (table->dirty == NULL) {
+    return;
+  }
+  size_t offset = (const uint8_t*) addr - (const uint8_t*) table->header;
+  size_t first = offset / page_size();
+  size_t last = (offset + len - 1) / page_size();
+  for (size_t page = first; page <= last; page++) {
+    table->dirty[page / 64] |= UINT64_C(1) << (page % 64);
+  }
+  if (first < table->dirty_lo) {
+    table->dirty_lo = first;
+  }
+  if (last + 1 > table->dirty_hi) {
+    table->dirty_hi = last + 1;
+  }
+}
+
+static bool is_page_dirty(phm_table* table, size_t page) {
+  return table->dirty[page / 64] & (UINT64_C(1) << (page % 64));
+}
+
+static void clear_dirty_pages(phm_table* table) {
+  if (table->dirty != NULL && table->dirty_lo < table->dirty_hi) {
+    size_t first_word = table->dirty_lo / 64;
+    size_t last_word = (table->dirty_hi - 1) / 64;
+    memset(table->dirty + first_word, 0, (last_word - first_word + 1) * sizeof(uint64_t));
+  }
+  table->dirty_lo = SIZE_MAX;
+  table->dirty_hi = 0;
+  table->last_sync = time(NULL);
+}
+
+static void clear_run(phm_table* table, size_t first, size_t last) {
+  for (size_t page = first; page < last; page++) {
+    table->dirty[page / 64] &= ~(UINT64_C(1) << (page % 64));
+  }
+}
+
+// msync each contiguous run of dirty pages, so a batch that touched a handful of
+// entries costs a handful of page writes rather than a flush of the whole file.
+// Runs that fail stay dirty so the next flush retries them.
+static int flush_dirty_pages(phm_table* table) {
+  int ret = 0;
+  size_t failed_lo = SIZE_MAX;
+  size_t failed_hi = 0;
+  size_t page = table->dirty_lo;
+  while (page < table->dirty_hi) {
+    if (!is_page_dirty(table, page)) {
+      page++;
+      continue;
+    }
+    size_t run = page;
+    while (run < table->dirty_hi && is_page_dirty(table, run)) {
+      run++;
+    }
+    uint8_t* addr = (uint8_t*) table->header + page * page_size();
+    size_t len = (run - page) * page_size();
+    if (addr + len > (uint8_t*) table->header + table->len) {
+      len = (uint8_t*) table->header + table->len - addr;
+    }
+    if (msync(addr, len, MS_SYNC) == -1) {
+      fprintf(stderr, "Could not flush table: %s\n", strerror(errno));
+      ret = -1;
+      if (page < failed_lo) {
+        failed_lo = page;
+      }
+      failed_hi = run;
+    } else {
+      clear_run(table, page, run);
+    }
+    page = run;
+  }
+
+  table->dirty_lo = failed_lo;
+  table->dirty_hi = failed_hi;
+  if (ret == 0) {
+    table->last_sync = time(NULL);
+  }
+  return ret;
+}
+
+int sync_table(phm_table* table, bool force) {
+  switch (table->durability) {
+  case PHM_DURABILITY_NONE:
+    return 0;
+  case PHM_DURABILITY_PERIODIC:
+    if (!force && time(NULL) - table->last_sync < table->sync_interval) {
+      return 0;
+    }
+    return flush_dirty_pages(table);
+  case PHM_DURABILITY_SYNC:
+    return flush_dirty_pages(table);
+  }
+  return 0;
+}
+
+int phm_set_durability(phm_table* table, phm_durability durability, int interval) {
+  if (durability != PHM_DURABILITY_NONE && table->dirty == NULL) {
+    size_t pages = (table->len + page_size() - 1) / page_size();
+    table->dirty = (uint64_t*) calloc((pages + 63) / 64, sizeof(uint64_t));
+    if (table->dirty == NULL) {
+      fprintf(stderr, "Could not track dirty pages: %s\n", strerror(errno));
+      return -1;
+    }
+    table->dirty_lo = SIZE_MAX;
+    table->dirty_hi = 0;
+    table->last_sync = time(NULL);
+  }
+  table->durability = durability;
+  table->sync_interval = interval;
+  return 0;
+}
+
+void phm_begin_batch(phm_table* table) {
+  table->in_batch = true;
+}
+
+int phm_commit_batch(phm_table* table) {
+  table->in_batch = false;
+  return sync_table(table, false);
+}
+
+int phm_sync(phm_table* table) {
+  return sync_table(table, true);
+}
+
+static int flush_all(phm_table* table) {
+  if (msync(table->header, table->len, MS_SYNC) == -1) {
+    fprintf(stderr, "Could not flush table: %s\n", strerror(errno));
+    return -1;
+  }
+  clear_dirty_pages(table);
+  return 0;
+}
+
+static int flush_header(phm_table* table) {
+  if (msync(table->header, sizeof(phm_header), MS_SYNC) == -1) {
+    fprintf(stderr, "Could not flush table header: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static bool verify_entry(phm_table* table, phm_index* index) {
+  phm_header* header = table->header;
+  if (index->assoc_offset % header->max_assoc_bytes != 0 ||
+      index->assoc_offset >= header->next_free_assoc ||
+      index->assoc_offset / header->max_assoc_bytes >= (size_t) header->table_size) {
+    return false;
+  }
+  phm_assoc* assoc = get_assoc_by_index(table, index);
+  if (assoc->key_size < 0 || assoc->value_size < 0 ||
+      assoc->key_size + assoc->value_size > header->max_assoc_bytes) {
+    return false;
+  }
+  return index->crc == entry_crc(index, assoc);
+}
+
+// Only entries written in the generation that was live when the process died can
+// be torn; everything older was flushed by the checkpoint that ended its
+// generation. That keeps recovery to one pass over the index plus a crc of the
+// few entries touched since the last checkpoint.
+static void recover_table(phm_table* table) {
+  phm_header* header = table->header;
+  size_t checked = 0;
+  size_t discarded = 0;
+  for (int i = 0; i < header->table_size; i++) {
+    phm_index* index = table->index + i;
+    if (index->expiry == 0 || index->generation != header->generation) {
+      continue;
+    }
+    checked++;
+    if (verify_entry(table, index)) {
+      continue;
+    }
+    discarded++;
+    LOG("discarding torn entry %d (hash %zu)\n", i, index->hash);
+    // Release the slot but keep a nonzero hash, so it stays in its linear
+    // probe chain; match_key ignores entries with expiry 0.
+    index->expiry = 0;
+    if (index->hash == 0) {
+      index->hash = 1;
+    }
+    if (index->assoc_offset >= header->next_free_assoc ||
+        index->assoc_offset % header->max_assoc_bytes != 0) {
+      // The slot will be reused through its assoc_offset, so give it a sound
+      // one from the bump pointer. A slot with a bad offset never owned an
+      // assoc, so this cannot take more than table_size assocs in total.
+      index->assoc_offset = header->next_free_assoc;
+      header->next_free_assoc += header->max_assoc_bytes;
+    }
+  }
+  fprintf(stderr, "Table was not shut down cleanly: checked %zu entries, discarded %zu\n",
+          checked, discarded);
+}
+
+int phm_checkpoint(phm_table* table) {
+  if (table->readonly) {
+    return -1;
+  }
+  if (flush_all(table) != 0) {
+    return -1;
+  }
+  mark_dirty(table, table->header, sizeof(phm_header));
+  table->header->generation++;
+  return flush_header(table);
+}
+
+int open_generation(phm_table* table) {
+  if (!table->header->clean_shutdown) {
+    recover_table(table);
+  }
+  mark_dirty(table, table->header, sizeof(phm_header));
+  table->header->clean_shutdown = 0;
+  return phm_checkpoint(table);
+}
+
+int close_generation(phm_table* table) {
+  if (flush_all(table) != 0) {
+    return -1;
+  }
+  mark_dirty(table, table->header, sizeof(phm_header));
+  table->header->clean_shutdown = 1;
+  return flush_header(table);
+}
@@ -6,6 +6,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "stats.h"
 
 #ifdef DEBUG
 
@@ -17,16 +21,56 @@
 
 #endif
 
+// Static tracepoints. With <sys/sdt.h> each TRACE is a single nop plus an ELF
+// note, so it costs nothing until perf/bpftrace/systemtap attaches to
+// usdt:phm:<name>. Define PHM_NO_USDT to compile them out entirely.
+#if !defined(PHM_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PHM_HAVE_USDT
+#endif
+#endif
+
+#ifdef PHM_HAVE_USDT
+
+#define TRACE(name, ...) STAP_PROBEV(phm, name, ##__VA_ARGS__)
+
+#else
+
+#define TRACE(name, ...)
+
+#endif
+
+// Identifies a table file and its layout. Bump PHM_VERSION whenever
+// phm_header, phm_index or phm_assoc change.
+#define PHM_MAGIC 0x544d4850  // "PHMT"
+#define PHM_VERSION 1
+
 typedef struct {
+  uint32_t magic;
+  uint32_t version;
   int table_size;
   int max_assoc_bytes;
   size_t next_free_assoc;
+  // Bumped at every checkpoint; entries record the generation that last wrote
+  // them, so after a crash only entries of the current generation need checking.
+  uint32_t generation;
+  uint32_t clean_shutdown;
+  uint32_t engine;
+  // Position of this file in a phm_sharded_table; shard_count is 0 for a
+  // standalone table.
+  uint32_t shard_index;
+  uint32_t shard_count;
+  // Pads the header to a cache line so index entries never straddle one.
+  uint8_t reserved[20];
 } phm_header;
 
 typedef struct {
   size_t hash;
   time_t expiry;
   size_t assoc_offset;
+  uint32_t crc;         // crc32c of hash and assoc; expiry is not covered
+  uint32_t generation;
 } phm_index;
 
 typedef struct {
@@ -36,17 +80,81 @@ typedef struct {
 } phm_assoc;
 
 // It is important that all alignments be multiples of 8 bytes.
-static_assert(sizeof(phm_header) == 16, "phm_header assumed to be 16 bytes");
-static_assert(sizeof(phm_index) == 24, "phm_index assumed to be 24 bytes");
+static_assert(sizeof(phm_header) == 64, "phm_header assumed to be 64 bytes");
+static_assert(sizeof(phm_index) == 32, "phm_index assumed to be 32 bytes");
 static_assert(sizeof(phm_assoc) == 8, "phm_assoc assumed to be 8 bytes");
 
 struct phm_table {
   phm_header* header;
   phm_index* index;
   uint8_t* assoc;
+  size_t len;
   int fd;
+  bool readonly;
+
+  // Pages written since the last flush, one bit per page of the mapping.
+  // Only allocated once a durability mode other than NONE is selected.
+  uint64_t* dirty;
+  size_t dirty_lo;
+  size_t dirty_hi;
+  phm_durability durability;
+  int sync_interval;
+  time_t last_sync;
+  bool in_batch;
+
+  // Online snapshot in progress, see snapshot.c.
+  struct phm_snapshot* snapshot;
+
+  // Process-local instrumentation; never written to the file.
+  phm_stats stats;
+  unsigned int sample_interval;
+  unsigned int sample_countdown;
+  phm_latency_histogram latency[PHM_OP_COUNT];
 };
 
+// Must be called before [addr, addr + len) of the mapping is modified: it
+// records the pages for the next flush and lets a running snapshot copy the
+// region out first.
+void mark_dirty(phm_table* table, const void* addr, size_t len);
+
+void preserve_snapshot(phm_table* table, const void* addr, size_t len);
+
+// Flushes dirty pages as the durability mode requires; `force` ignores the
+// periodic interval.
+int sync_table(phm_table* table, bool force);
+
+// Called on a writable open: verifies the entries written since the last
+// checkpoint if the table was not shut down cleanly, then starts a new
+// generation.
+int open_generation(phm_table* table);
+
+// Called on close: flushes everything and marks the table clean.
+int close_generation(phm_table* table);
+
+void record_latency(phm_table* table, phm_op op, uint64_t ns);
+
+static inline bool sample_latency(phm_table* table) {
+  if (table->sample_interval == 0 || --table->sample_countdown != 0) {
+    return false;
+  }
+  table->sample_countdown = table->sample_interval;
+  return true;
+}
+
+static inline size_t page_size() {
+  static size_t size = 0;
+  if (size == 0) {
+    size = (size_t) sysconf(_SC_PAGESIZE);
+  }
+  return size;
+}
+
+static inline uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static inline phm_assoc* get_assoc_by_index(phm_table* table, phm_index* index) {
   return (phm_assoc*) (table->assoc + index->assoc_offset);
 }
@@ -59,4 +167,9 @@ static inline uint8_t* get_value(phm_assoc* assoc) {
   return assoc->bytes + assoc->key_size;
 }
 
+static inline uint32_t entry_crc(phm_index* index, phm_assoc* assoc) {
+  uint32_t crc = crc32c(0, &index->hash, sizeof(index->hash));
+  return crc32c(crc, assoc, sizeof(phm_assoc) + assoc->key_size + assoc->value_size);
+}
+
 #endif
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sharded.h"
+#include "internal.h"
+
+struct phm_sharded_table {
+  int shard_count;
+  phm_table** shards;
+  int* cpus;
+};
+
+static void shard_path(char* buf, size_t size, const char* path, int shard) {
+  snprintf(buf, size, "%s.%d", path, shard);
+}
+
+static phm_sharded_table* alloc_sharded(int shard_count) {
+  phm_sharded_table* sharded = (phm_sharded_table*) calloc(1, sizeof(phm_sharded_table));
+  if (sharded == NULL) {
+    return NULL;
+  }
+  sharded->shard_count = shard_count;
+  sharded->shards = (phm_table**) calloc(shard_count, sizeof(phm_table*));
+  sharded->cpus = (int*) malloc(shard_count * sizeof(int));
+  if (sharded->shards == NULL || sharded->cpus == NULL) {
+    free(sharded->shards);
+    free(sharded->cpus);
+    free(sharded);
+    return NULL;
+  }
+  for (int i = 0; i < shard_count; i++) {
+    sharded->cpus[i] = -1;
+  }
+  return sharded;
+}
+
+static void free_sharded(phm_sharded_table* sharded) {
+  free(sharded->shards);
+  free(sharded->cpus);
+  free(sharded);
+}
+
+phm_sharded_table* phm_sharded_create(const char* path,
+                                      int shard_count,
+                                      int shard_size,
+                                      int max_assoc_bytes,
+                                      phm_engine engine) {
+  if (shard_count <= 0) {
+    fprintf(stderr, "Invalid arguments: shard_count = %d\n", shard_count);
+    return NULL;
+  }
+  phm_sharded_table* sharded = alloc_sharded(shard_count);
+  if (sharded == NULL) {
+    fprintf(stderr, "Could not create sharded table \"%s\" [malloc]: %s\n", path, strerror(errno));
+    return NULL;
+  }
+
+  char buf[PATH_MAX];
+  for (int i = 0; i < shard_count; i++) {
+    shard_path(buf, sizeof(buf), path, i);
+    sharded->shards[i] = phm_create_table_with_engine(buf, shard_size, max_assoc_bytes, engine);
+    if (sharded->shards[i] != NULL) {
+      phm_table* shard = sharded->shards[i];
+      mark_dirty(shard, shard->header, sizeof(phm_header));
+      shard->header->shard_index = i;
+      shard->header->shard_count = shard_count;
+      if (phm_checkpoint(shard) != 0) {
+        phm_close_table(shard);
+        remove(buf);
+        sharded->shards[i] = NULL;
+      }
+    }
+    if (sharded->shards[i] == NULL) {
+      for (int j = 0; j < i; j++) {
+        phm_close_table(sharded->shards[j]);
+        shard_path(buf, sizeof(buf), path, j);
+        remove(buf);
+      }
+      free_sharded(sharded);
+      return NULL;
+    }
+  }
+  return sharded;
+}
+
+static phm_table* open_shard(const char* path, int shard, bool readonly) {
+  char buf[PATH_MAX];
+  shard_path(buf, sizeof(buf), path, shard);
+  return readonly ? phm_open_table_readonly(buf) : phm_open_table(buf);
+}
+
+// The shard count is recorded in every shard's header. Shard 0 says how many
+// there should be and every other shard must agree on the count and on its own
+// position, so a missing or misplaced file fails the open instead of silently
+// sending keys to the wrong shard.
+static phm_sharded_table* open_sharded(const char* path, bool readonly) {
+  const char* err = "Could not open sharded table \"%s\": %s\n";
+
+  phm_table* first = open_shard(path, 0, readonly);
+  if (first == NULL) {
+    return NULL;
+  }
+  int shard_count = (int) first->header->shard_count;
+  if (shard_count <= 0 || first->header->shard_index != 0) {
+    fprintf(stderr, err, path, "shard 0 is not part of a sharded table");
+    phm_close_table(first);
+    return NULL;
+  }
+
+  phm_sharded_table* sharded = alloc_sharded(shard_count);
+  if (sharded == NULL) {
+    fprintf(stderr, err, path, strerror(errno));
+    phm_close_table(first);
+    return NULL;
+  }
+  sharded->shards[0] = first;
+  for (int i = 1; i < shard_count; i++) {
+    phm_table* shard = open_shard(path, i, readonly);
+    if (shard != NULL &&
+        (shard->header->shard_count != (uint32_t) shard_count || shard->header->shard_index != (uint32_t) i)) {
+      fprintf(stderr, "Could not open sharded table \"%s\": shard %d records position %u of %u, expected %d of %d\n",
+              path, i, shard->header->shard_index, shard->header->shard_count, i, shard_count);
+      phm_close_table(shard);
+      shard = NULL;
+    }
+    if (shard == NULL) {
+      for (int j = 0; j < i; j++) {
+        phm_close_table(sharded->shards[j]);
+      }
+      free_sharded(sharded);
+      return NULL;
+    }
+    sharded->shards[i] = shard;
+  }
+  return sharded;
+}
+
+phm_sharded_table* phm_sharded_open(const char* path) {
+  return open_sharded(path, false);
+}
+
+phm_sharded_table* phm_sharded_open_readonly(const char* path) {
+  return open_sharded(path, true);
+}
+
+void phm_sharded_close(phm_sharded_table* sharded) {
+  for (int i = 0; i < sharded->shard_count; i++) {
+    phm_close_table(sharded->shards[i]);
+  }
+  free_sharded(sharded);
+}
+
+int phm_sharded_get_shard_count(phm_sharded_table* sharded) {
+  return sharded->shard_count;
+}
+
+// Multiply-shift on the high half: shards get contiguous ranges of the high
+// bits, leaving the low bits that pick a slot within the shard uncorrelated.
+int phm_sharded_shard_of(phm_sharded_table* sharded, size_t hash) {
+  uint64_t high = (uint64_t) hash >> 32;
+  return (int) ((high * (uint64_t) sharded->shard_count) >> 32);
+}
+
+phm_table* phm_sharded_get_shard(phm_sharded_table* sharded, int shard) {
+  assert(shard >= 0 && shard < sharded->shard_count);
+  return sharded->shards[shard];
+}
+
+int phm_sharded_put(phm_sharded_table* sharded,
+                    size_t hash, const uint8_t* key, int key_size,
+                    const uint8_t* value, int value_size,
+                    time_t expiry, time_t now) {
+  phm_table* table = sharded->shards[phm_sharded_shard_of(sharded, hash)];
+  return phm_put(table, hash, key, key_size, value, value_size, expiry, now);
+}
+
+int phm_sharded_get(phm_sharded_table* sharded,
+                    size_t hash, const uint8_t* key, int key_size,
+                    const uint8_t** value,
+                    time_t new_expiry) {
+  phm_table* table = sharded->shards[phm_sharded_shard_of(sharded, hash)];
+  return phm_get(table, hash, key, key_size, value, new_expiry);
+}
+
+int phm_sharded_peek(phm_sharded_table* sharded,
+                     size_t hash, const uint8_t* key, int key_size,
+                     const uint8_t** value) {
+  phm_table* table = sharded->shards[phm_sharded_shard_of(sharded, hash)];
+  return phm_peek(table, hash, key, key_size, value);
+}
+
+void phm_sharded_get_stats(phm_sharded_table* sharded, phm_stats* stats) {
+  memset(stats, 0, sizeof(phm_stats));
+  for (int i = 0; i < sharded->shard_count; i++) {
+    phm_stats shard;
+    phm_get_stats(sharded->shards[i], &shard);
+    stats->cache_hit += shard.cache_hit;
+    stats->cache_miss += shard.cache_miss;
+    stats->expiration += shard.expiration;
+    stats->eviction += shard.eviction;
+  }
+}
+
+int phm_sharded_bind_shard(phm_sharded_table* sharded, int shard, int cpu) {
+  assert(shard >= 0 && shard < sharded->shard_count);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    fprintf(stderr, "Could not bind shard %d to cpu %d: %s\n", shard, cpu, strerror(errno));
+    return -1;
+  }
+  sharded->cpus[shard] = cpu;
+  return 0;
+}
+
+int phm_sharded_get_shard_cpu(phm_sharded_table* sharded, int shard) {
+  assert(shard >= 0 && shard < sharded->shard_count);
+  return sharded->cpus[shard];
+}
+
+static phm_sharded_iterator skip_empty_shards(phm_sharded_table* sharded, phm_sharded_iterator it) {
+  while (it.shard < sharded->shard_count &&
+         it.iterator == phm_iterator_end(sharded->shards[it.shard])) {
+    it.shard++;
+    if (it.shard < sharded->shard_count) {
+      it.iterator = phm_iterator_begin(sharded->shards[it.shard]);
+    }
+  }
+  return it;
+}
+
+phm_sharded_iterator phm_sharded_iterator_begin(phm_sharded_table* sharded) {
+  phm_sharded_iterator it = { 0, phm_iterator_begin(sharded->shards[0]) };
+  return skip_empty_shards(sharded, it);
+}
+
+bool phm_sharded_iterator_done(phm_sharded_table* sharded, phm_sharded_iterator iterator) {
+  return iterator.shard >= sharded->shard_count;
+}
+
+phm_sharded_iterator phm_sharded_iterator_advance(phm_sharded_table* sharded, phm_sharded_iterator iterator) {
+  iterator.iterator = phm_iterator_advance(sharded->shards[iterator.shard], iterator.iterator);
+  return skip_empty_shards(sharded, iterator);
+}
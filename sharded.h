@@ -0,0 +1,79 @@
+#ifndef phm_sharded_h
+#define phm_sharded_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "table.h"
+#include "iterator.h"
+#include "stats.h"
+
+// A set of independent tables stored as <path>.0 ... <path>.N-1. A key lives in
+// the shard picked by the high 32 bits of its hash, so callers must supply
+// hashes whose high bits are well mixed. Each shard has its own header, bump
+// pointer and file lock, so threads working on different shards never
+// contend; a single shard is no more thread-safe than a phm_table. Each
+// shard's header records its position and the shard count, and open fails if
+// any file is missing or out of place.
+typedef struct phm_sharded_table phm_sharded_table;
+
+phm_sharded_table* phm_sharded_create(const char* path,
+                                      int shard_count,
+                                      int shard_size,
+                                      int max_assoc_bytes,
+                                      phm_engine engine);
+
+phm_sharded_table* phm_sharded_open(const char* path);
+
+phm_sharded_table* phm_sharded_open_readonly(const char* path);
+
+void phm_sharded_close(phm_sharded_table* sharded);
+
+int phm_sharded_get_shard_count(phm_sharded_table* sharded);
+
+int phm_sharded_shard_of(phm_sharded_table* sharded, size_t hash);
+
+phm_table* phm_sharded_get_shard(phm_sharded_table* sharded, int shard);
+
+int phm_sharded_put(phm_sharded_table* sharded,
+                    size_t hash, const uint8_t* key, int key_size,
+                    const uint8_t* value, int value_size,
+                    time_t expiry, time_t now);
+
+int phm_sharded_get(phm_sharded_table* sharded,
+                    size_t hash, const uint8_t* key, int key_size,
+                    const uint8_t** value,
+                    time_t new_expiry);
+
+int phm_sharded_peek(phm_sharded_table* sharded,
+                     size_t hash, const uint8_t* key, int key_size,
+                     const uint8_t** value);
+
+// Sums the counters of every shard; use phm_get_stats on
+// phm_sharded_get_shard for a single shard.
+void phm_sharded_get_stats(phm_sharded_table* sharded, phm_stats* stats);
+
+// Pins the calling thread to `cpu` and records it as the shard's owner. Pin
+// before the thread first touches the shard so its page cache is allocated
+// on the local NUMA node.
+int phm_sharded_bind_shard(phm_sharded_table* sharded, int shard, int cpu);
+
+// Returns the cpu the shard was bound to, or -1.
+int phm_sharded_get_shard_cpu(phm_sharded_table* sharded, int shard);
+
+typedef struct {
+    int shard;
+    phm_iterator iterator;
+} phm_sharded_iterator;
+
+// Visits every live entry shard by shard. Read entries with the phm_iterator_*
+// accessors on phm_sharded_get_shard(sharded, it.shard) and it.iterator.
+phm_sharded_iterator phm_sharded_iterator_begin(phm_sharded_table* sharded);
+
+bool phm_sharded_iterator_done(phm_sharded_table* sharded, phm_sharded_iterator iterator);
+
+phm_sharded_iterator phm_sharded_iterator_advance(phm_sharded_table* sharded, phm_sharded_iterator iterator);
+
+#endif
@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "table.h"
+#include "internal.h"
+
+// Copy granularity. Large enough that a pass is mostly sequential I/O, small
+// enough that a write into a not-yet-copied region stays cheap.
+#define CHUNK_SIZE (64 * 1024)
+
+struct phm_snapshot {
+  int fd;
+  char* path;
+  // Everything past `end` was zero when the snapshot began, so the sparse
+  // destination already holds it; only the `chunks` chunks below it are copied.
+  size_t end;
+  size_t chunks;
+  size_t cursor;
+  uint64_t* copied;
+  bool failed;
+};
+
+static bool is_copied(struct phm_snapshot* snapshot, size_t chunk) {
+  return snapshot->copied[chunk / 64] & (UINT64_C(1) << (chunk % 64));
+}
+
+// Returns the number of bytes written, or -1.
+static ssize_t copy_chunk(phm_table* table, size_t chunk) {
+  struct phm_snapshot* snapshot = table->snapshot;
+  snapshot->copied[chunk / 64] |= UINT64_C(1) << (chunk % 64);
+
+  size_t offset = chunk * CHUNK_SIZE;
+  size_t len = snapshot->end - offset < CHUNK_SIZE ? snapshot->end - offset : CHUNK_SIZE;
+  ssize_t total = len;
+  const uint8_t* src = (const uint8_t*) table->header + offset;
+  while (len > 0) {
+    ssize_t written = pwrite(snapshot->fd, src, len, offset);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Could not write snapshot \"%s\": %s\n", snapshot->path, strerror(errno));
+      return -1;
+    }
+    src += written;
+    offset += written;
+    len -= written;
+  }
+  return total;
+}
+
+void preserve_snapshot(phm_table* table, const void* addr, size_t len) {
+  struct phm_snapshot* snapshot = table->snapshot;
+  size_t offset = (const uint8_t*) addr - (const uint8_t*) table->header;
+  if (offset >= snapshot->end) {
+    return;
+  }
+  size_t last = (offset + len - 1) / CHUNK_SIZE;
+  for (size_t chunk = offset / CHUNK_SIZE; chunk <= last && chunk < snapshot->chunks; chunk++) {
+    if (!is_copied(snapshot, chunk)) {
+      if (copy_chunk(table, chunk) == -1) {
+        snapshot->failed = true;
+      }
+    }
+  }
+}
+
+static void free_snapshot(phm_table* table) {
+  struct phm_snapshot* snapshot = table->snapshot;
+  close(snapshot->fd);
+  free(snapshot->copied);
+  free(snapshot->path);
+  free(snapshot);
+  table->snapshot = NULL;
+}
+
+void phm_snapshot_abort(phm_table* table) {
+  if (table->snapshot == NULL) {
+    return;
+  }
+  remove(table->snapshot->path);
+  free_snapshot(table);
+}
+
+// The image is a copy of the table between two operations, so it is as
+// consistent as a clean close and is marked as one.
+static int mark_clean(int fd) {
+  uint32_t clean = 1;
+  if (pwrite(fd, &clean, sizeof(clean), offsetof(phm_header, clean_shutdown)) != sizeof(clean)) {
+    return -1;
+  }
+  return fsync(fd);
+}
+
+int phm_snapshot_begin(phm_table* table, const char* dest_path) {
+  const char* err = "Could not start snapshot \"%s\" [%s]: %s\n";
+  if (table->readonly) {
+    fprintf(stderr, err, dest_path, "begin", "table is open read-only");
+    return -1;
+  }
+  if (table->snapshot != NULL) {
+    fprintf(stderr, err, dest_path, "begin", "a snapshot is already in progress");
+    return -1;
+  }
+
+  struct phm_snapshot* snapshot = (struct phm_snapshot*) calloc(1, sizeof(struct phm_snapshot));
+  if (snapshot == NULL) {
+    fprintf(stderr, err, dest_path, "malloc", strerror(errno));
+    return -1;
+  }
+  snapshot->end = (table->assoc - (uint8_t*) table->header) + table->header->next_free_assoc
+                  + sizeof(phm_assoc);
+  if (snapshot->end > table->len) {
+    snapshot->end = table->len;
+  }
+  snapshot->chunks = (snapshot->end + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  snapshot->copied = (uint64_t*) calloc((snapshot->chunks + 63) / 64, sizeof(uint64_t));
+  snapshot->path = strdup(dest_path);
+  if (snapshot->copied == NULL || snapshot->path == NULL) {
+    fprintf(stderr, err, dest_path, "malloc", strerror(errno));
+    free(snapshot->copied);
+    free(snapshot->path);
+    free(snapshot);
+    return -1;
+  }
+
+  snapshot->fd = open(dest_path, O_WRONLY | O_CREAT | O_EXCL, 0660);
+  if (snapshot->fd == -1) {
+    fprintf(stderr, err, dest_path, "open", strerror(errno));
+    free(snapshot->copied);
+    free(snapshot->path);
+    free(snapshot);
+    return -1;
+  }
+  table->snapshot = snapshot;
+
+  if (ftruncate(snapshot->fd, table->len) != 0) {
+    fprintf(stderr, err, dest_path, "ftruncate", strerror(errno));
+    phm_snapshot_abort(table);
+    return -1;
+  }
+  return 0;
+}
+
+// Adds the bytes it writes to *written.
+static int snapshot_step(phm_table* table, size_t max_bytes, size_t* written) {
+  struct phm_snapshot* snapshot = table->snapshot;
+  if (snapshot == NULL) {
+    return 0;
+  }
+
+  // Only bytes actually written count against max_bytes, so the rate limit
+  // paces the data, not the provisioned size of the file.
+  size_t step_written = 0;
+  while (snapshot->cursor < snapshot->chunks && step_written < max_bytes) {
+    size_t chunk = snapshot->cursor++;
+    if (is_copied(snapshot, chunk)) {
+      continue;
+    }
+    ssize_t ret = copy_chunk(table, chunk);
+    if (ret == -1) {
+      phm_snapshot_abort(table);
+      return -1;
+    }
+    step_written += ret;
+  }
+  *written += step_written;
+  if (snapshot->cursor < snapshot->chunks) {
+    return 1;
+  }
+  if (snapshot->failed) {
+    phm_snapshot_abort(table);
+    return -1;
+  }
+
+  if (mark_clean(snapshot->fd) != 0) {
+    fprintf(stderr, "Could not finish snapshot \"%s\": %s\n", snapshot->path, strerror(errno));
+    phm_snapshot_abort(table);
+    return -1;
+  }
+  free_snapshot(table);
+  return 0;
+}
+
+int phm_snapshot_step(phm_table* table, size_t max_bytes) {
+  size_t written = 0;
+  return snapshot_step(table, max_bytes, &written);
+}
+
+// A reflink shares every extent with the source, so the copy is instant and
+// takes no space until either side is written. The filesystem writes back the
+// source's dirty pages before cloning.
+static int clone_table_file(phm_table* table, const char* dest_path) {
+#ifdef FICLONE
+  int fd = open(dest_path, O_WRONLY | O_CREAT | O_EXCL, 0660);
+  if (fd == -1) {
+    return -1;
+  }
+  if (ioctl(fd, FICLONE, table->fd) != 0 || mark_clean(fd) != 0) {
+    close(fd);
+    remove(dest_path);
+    return -1;
+  }
+  close(fd);
+  return 0;
+#else
+  (void) table;
+  (void) dest_path;
+  return -1;
+#endif
+}
+
+int phm_snapshot(phm_table* table, const char* dest_path, size_t bytes_per_sec) {
+  if (!table->readonly && table->snapshot == NULL && clone_table_file(table, dest_path) == 0) {
+    return 0;
+  }
+
+  if (phm_snapshot_begin(table, dest_path) != 0) {
+    return -1;
+  }
+  size_t written = 0;
+  if (bytes_per_sec == 0) {
+    return snapshot_step(table, SIZE_MAX, &written);
+  }
+
+  // Copy in slices of about a tenth of a second's budget, then sleep until the
+  // bytes written so far are due at bytes_per_sec. A step copies whole chunks,
+  // so it may overshoot the slice; the sleep absorbs that.
+  size_t slice = bytes_per_sec / 10 > 0 ? bytes_per_sec / 10 : 1;
+  uint64_t start = monotonic_ns();
+  int ret;
+  while ((ret = snapshot_step(table, slice, &written)) == 1) {
+    uint64_t due = start + (uint64_t) ((double) written / bytes_per_sec * 1e9);
+    uint64_t now = monotonic_ns();
+    if (due > now) {
+      struct timespec pause = { (time_t) ((due - now) / 1000000000),
+                                (long) ((due - now) % 1000000000) };
+      nanosleep(&pause, NULL);
+    }
+  }
+  return ret;
+}
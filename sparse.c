@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "table.h"
+#include "stats.h"
+#include "internal.h"
+
+static void mark_live(uint64_t* live, size_t first, size_t last) {
+  for (size_t page = first; page <= last; page++) {
+    live[page / 64] |= UINT64_C(1) << (page % 64);
+  }
+}
+
+static bool is_live(uint64_t* live, size_t page) {
+  return live[page / 64] & (UINT64_C(1) << (page % 64));
+}
+
+// Releases every entry that expired before `now` and finds the assoc pages
+// that no remaining entry touches. Returns the page bitmap, or NULL.
+static uint64_t* release_expired(phm_table* table, time_t now) {
+  size_t pages = (table->len + page_size() - 1) / page_size();
+  uint64_t* live = (uint64_t*) calloc((pages + 63) / 64, sizeof(uint64_t));
+  if (live == NULL) {
+    return NULL;
+  }
+
+  size_t assoc_start = table->assoc - (uint8_t*) table->header;
+  for (int i = 0; i < table->header->table_size; i++) {
+    phm_index* index = table->index + i;
+    if (index->expiry == 0 && index->hash == 0) {
+      continue;
+    }
+    if (index->expiry == 0) {
+      // Released already; its assoc may have been punched by an earlier trim.
+      continue;
+    }
+    if (index->expiry < now) {
+      // The slot keeps its hash, and so its place in the probe chain, but with
+      // expiry 0 match_key never looks at its assoc again.
+      mark_dirty(table, index, sizeof(phm_index));
+      index->expiry = 0;
+      continue;
+    }
+    phm_assoc* assoc = get_assoc_by_index(table, index);
+    size_t start = assoc_start + index->assoc_offset;
+    size_t end = start + sizeof(phm_assoc) + assoc->key_size + assoc->value_size;
+    mark_live(live, start / page_size(), (end - 1) / page_size());
+  }
+  return live;
+}
+
+// Punches the parts of [start, end) that still hold data, one fallocate per
+// extent. Extents that are already holes are skipped so repeated sweeps don't
+// dirty, flush or snapshot them again. Punching through the fd also drops the
+// pages from the shared mapping, as MADV_REMOVE would. Returns the number of
+// bytes newly released, or -1.
+static ssize_t punch_run(phm_table* table, size_t start, size_t end) {
+  ssize_t released = 0;
+  size_t pos = start;
+  while (pos < end) {
+    off_t data = lseek(table->fd, pos, SEEK_DATA);
+    off_t hole;
+    if (data == -1 && errno != ENXIO) {
+      // No SEEK_DATA support: treat the whole run as data.
+      data = pos;
+      hole = end;
+    } else if (data == -1 || (size_t) data >= end) {
+      break;
+    } else {
+      hole = lseek(table->fd, data, SEEK_HOLE);
+    }
+    size_t from = (size_t) data / page_size() * page_size();
+    size_t to = hole == -1 || (size_t) hole > end ? end : (size_t) hole;
+    to = (to + page_size() - 1) / page_size() * page_size();
+    if (from < pos) {
+      from = pos;
+    }
+    if (to > end) {
+      to = end;
+    }
+    mark_dirty(table, (uint8_t*) table->header + from, to - from);
+    if (fallocate(table->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, from, to - from) != 0) {
+      fprintf(stderr, "Could not punch hole in table: %s\n", strerror(errno));
+      return -1;
+    }
+    released += to - from;
+    pos = to;
+  }
+  return released;
+}
+
+ssize_t phm_trim(phm_table* table, time_t now) {
+  if (table->readonly) {
+    fprintf(stderr, "Cannot trim a table opened read-only.\n");
+    return -1;
+  }
+
+  uint64_t* live = release_expired(table, now);
+  if (live == NULL) {
+    fprintf(stderr, "Could not trim table: %s\n", strerror(errno));
+    return -1;
+  }
+
+  // Only whole pages inside the assoc region; the page shared with the tail of
+  // the index is never punched.
+  size_t assoc_start = table->assoc - (uint8_t*) table->header;
+  size_t assoc_end = assoc_start + table->header->next_free_assoc + sizeof(phm_assoc);
+  size_t first = (assoc_start + page_size() - 1) / page_size();
+  size_t last = (assoc_end + page_size() - 1) / page_size();
+  size_t max = table->len / page_size();
+  if (last > max) {
+    last = max;
+  }
+
+  ssize_t released = 0;
+  size_t page = first;
+  while (page < last) {
+    if (is_live(live, page)) {
+      page++;
+      continue;
+    }
+    size_t run = page;
+    while (run < last && !is_live(live, run)) {
+      run++;
+    }
+    ssize_t punched = punch_run(table, page * page_size(), run * page_size());
+    if (punched == -1) {
+      free(live);
+      return -1;
+    }
+    released += punched;
+    page = run;
+  }
+
+  free(live);
+  return released;
+}
+
+int phm_get_footprint(phm_table* table, phm_footprint* footprint) {
+  struct stat st;
+  if (fstat(table->fd, &st) != 0) {
+    fprintf(stderr, "Could not stat table: %s\n", strerror(errno));
+    return -1;
+  }
+
+  size_t pages = (table->len + page_size() - 1) / page_size();
+  unsigned char* resident = (unsigned char*) malloc(pages);
+  if (resident == NULL || mincore(table->header, table->len, resident) != 0) {
+    fprintf(stderr, "Could not measure resident pages: %s\n", strerror(errno));
+    free(resident);
+    return -1;
+  }
+  size_t resident_pages = 0;
+  for (size_t page = 0; page < pages; page++) {
+    resident_pages += resident[page] & 1;
+  }
+  free(resident);
+
+  footprint->logical_bytes = table->len;
+  footprint->allocated_bytes = (size_t) st.st_blocks * 512;
+  footprint->resident_bytes = resident_pages * page_size();
+  return 0;
+}
@@ -0,0 +1,46 @@
+#include <string.h>
+
+#include "stats.h"
+#include "internal.h"
+
+void phm_get_stats(phm_table* table, phm_stats* stats) {
+    *stats = table->stats;
+}
+
+void phm_set_latency_sampling(phm_table* table, unsigned int interval) {
+    table->sample_interval = interval;
+    table->sample_countdown = interval;
+}
+
+const phm_latency_histogram* phm_get_latency_histogram(phm_table* table, phm_op op) {
+    assert(op >= 0 && op < PHM_OP_COUNT);
+    return &table->latency[op];
+}
+
+void phm_reset_latency_histograms(phm_table* table) {
+    memset(table->latency, 0, sizeof(table->latency));
+}
+
+static int latency_bucket(uint64_t ns) {
+    if (ns < 4) {
+        return (int) ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (msb - 2)) & 3;
+    return 4 * (msb - 1) + sub;
+}
+
+uint64_t phm_latency_bucket_floor(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    int msb = bucket / 4 + 1;
+    int sub = bucket % 4;
+    return (uint64_t) (4 + sub) << (msb - 2);
+}
+
+void record_latency(phm_table* table, phm_op op, uint64_t ns) {
+    phm_latency_histogram* histogram = &table->latency[op];
+    histogram->samples++;
+    histogram->buckets[latency_bucket(ns)]++;
+}
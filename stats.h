@@ -2,6 +2,9 @@
 #define phm_stats_h
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
 
 typedef struct {
     size_t cache_hit;
@@ -10,6 +13,39 @@ typedef struct {
     size_t eviction;
 } phm_stats;
 
+typedef enum {
+    PHM_OP_GET,
+    PHM_OP_PUT,
+    PHM_OP_COUNT
+} phm_op;
+
+// Log-linear buckets: four sub-buckets per power of two, so every bucket is
+// within 25% of its neighbours. Bucket i holds latencies in nanoseconds in
+// [phm_latency_bucket_floor(i), phm_latency_bucket_floor(i + 1)).
+#define PHM_LATENCY_BUCKETS 252
+
+typedef struct {
+    size_t samples;
+    size_t buckets[PHM_LATENCY_BUCKETS];
+} phm_latency_histogram;
+
+typedef struct {
+    size_t logical_bytes;    // size of the table file
+    size_t allocated_bytes;  // blocks the filesystem has allocated for it
+    size_t resident_bytes;   // pages of the mapping in the page cache
+} phm_footprint;
+
+void phm_get_stats(phm_table* table, phm_stats* stats);
+
+int phm_get_footprint(phm_table* table, phm_footprint* footprint);
+
+// Time one in every `interval` operations; 0 disables sampling.
+void phm_set_latency_sampling(phm_table* table, unsigned int interval);
+
+const phm_latency_histogram* phm_get_latency_histogram(phm_table* table, phm_op op);
+
+void phm_reset_latency_histograms(phm_table* table);
 
+uint64_t phm_latency_bucket_floor(int bucket);
 
-#endif
\ No newline at end of file
+#endif
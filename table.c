@@ -13,16 +13,22 @@
 #include "table.h"
 #include "internal.h"
 
-static void init_header(phm_header* header,  int table_size, int max_assoc_bytes) {
+static void init_header(phm_header* header,  int table_size, int max_assoc_bytes, phm_engine engine) {
+  header->magic = PHM_MAGIC;
+  header->version = PHM_VERSION;
   header->table_size = table_size;
   header->max_assoc_bytes = max_assoc_bytes;
   header->next_free_assoc = 0;
+  header->generation = 0;
+  header->clean_shutdown = 1;
+  header->engine = engine;
 }
 
-static void init_table(phm_table* table, void* addr, int fd) {
+static void init_table(phm_table* table, void* addr, size_t len, int fd) {
   table->header = (phm_header*) addr;
   table->index = (phm_index*) ((uint8_t*) addr + sizeof(phm_header));
   table->assoc = (void*) (table->index + table->header->table_size);
+  table->len = len;
   table->fd = fd;
 }
 
@@ -34,13 +40,20 @@ static size_t calculate_len(int table_size, int max_assoc_bytes) {
   return header_size + index_size + assoc_size;
 }
 
+static bool is_valid_header(const phm_header* header, size_t len) {
+  return header->magic == PHM_MAGIC && header->version == PHM_VERSION &&
+         header->table_size > 0 && header->max_assoc_bytes > 0 &&
+         calculate_len(header->table_size, header->max_assoc_bytes) == len;
+}
+
 static size_t calculate_file_len(int fd) {
   off_t len = lseek(fd, 0, SEEK_END);
   lseek(fd, 0, SEEK_SET);
   return len;
 }
 
-static phm_table* open_or_create_and_lock_table_file(const char* path, int table_size, int max_assoc_bytes) {
+static phm_table* open_or_create_and_lock_table_file(const char* path, int table_size, int max_assoc_bytes,
+                                                     phm_engine engine) {
   if (((table_size > 0) ^ (max_assoc_bytes > 0)) || table_size < 0 || max_assoc_bytes < 0) {
     fprintf(stderr, "Invalid arguments: table_size = %d, max_assoc_bytes = %d\n", table_size, max_assoc_bytes);
     return NULL;
@@ -50,6 +63,11 @@ static phm_table* open_or_create_and_lock_table_file(const char* path, int table
     fprintf(stderr, "Rounding up max_assoc_bytes from %d to %d\n", max_assoc_bytes, max_assoc_bytes + incr);
     max_assoc_bytes += incr;
   }
+  if (engine == PHM_ENGINE_CUCKOO && table_size % PHM_CUCKOO_BUCKET_SLOTS != 0) {
+    int incr = PHM_CUCKOO_BUCKET_SLOTS - table_size % PHM_CUCKOO_BUCKET_SLOTS;
+    fprintf(stderr, "Rounding up table_size from %d to %d\n", table_size, table_size + incr);
+    table_size += incr;
+  }
 
   bool create = table_size > 0;
   const char* err = create 
@@ -73,6 +91,15 @@ static phm_table* open_or_create_and_lock_table_file(const char* path, int table
 
   size_t len = create ? calculate_len(table_size, max_assoc_bytes) : calculate_file_len(fd);
 
+  if (!create) {
+    phm_header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || !is_valid_header(&header, len)) {
+      fprintf(stderr, err, path, "header", "not a table file or an unsupported version");
+      close(fd);
+      return NULL;
+    }
+  }
+
   if (create) {
     if (ftruncate(fd, len) != 0) {
       fprintf(stderr, err, path, "ftruncate", strerror(errno));
@@ -94,53 +121,136 @@ static phm_table* open_or_create_and_lock_table_file(const char* path, int table
 
   if (create) {
     phm_header* header = (phm_header*) addr;
-    init_header(header, table_size, max_assoc_bytes);
+    init_header(header, table_size, max_assoc_bytes, engine);
   }
 
-  phm_table* table = (phm_table*) malloc(sizeof(phm_table));
+  phm_table* table = (phm_table*) calloc(1, sizeof(phm_table));
   if (table == NULL) {
     fprintf(stderr, err, path, "malloc", strerror(errno));
     close(fd);
     return NULL;
   }
 
-  init_table(table, addr, fd);
+  init_table(table, addr, len, fd);
+
+  if (open_generation(table) != 0) {
+    fprintf(stderr, err, path, "checkpoint", strerror(errno));
+    munmap(addr, len);
+    close(fd);
+    free(table);
+    return NULL;
+  }
+  return table;
+}
+
+// Readers take no lock: a writer holds LOCK_EX for as long as it has the table
+// open, so LOCK_SH would block until the serving process exits. Instead the
+// header is read up front and checked against the file length, which rejects
+// a file that is still being created.
+static phm_table* open_readonly_table_file(const char* path) {
+  const char* err = "Could not open table \"%s\" read-only [%s]: %s\n";
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, err, path, "open", strerror(errno));
+    return NULL;
+  }
+
+  phm_header header;
+  size_t len = calculate_file_len(fd);
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || !is_valid_header(&header, len)) {
+    fprintf(stderr, err, path, "header", "not a table file, an unsupported version or not initialised");
+    close(fd);
+    return NULL;
+  }
+
+  void* addr = mmap(NULL, len, PROT_READ, MAP_SHARED | MAP_FILE, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, err, path, "mmap", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  phm_table* table = (phm_table*) calloc(1, sizeof(phm_table));
+  if (table == NULL) {
+    fprintf(stderr, err, path, "malloc", strerror(errno));
+    munmap(addr, len);
+    close(fd);
+    return NULL;
+  }
+
+  init_table(table, addr, len, fd);
+  table->readonly = true;
   return table;
 }
 
 phm_table* phm_create_table(const char* path, int table_size, int max_assoc_bytes) {
-  return open_or_create_and_lock_table_file(path, table_size, max_assoc_bytes);
+  return open_or_create_and_lock_table_file(path, table_size, max_assoc_bytes, PHM_ENGINE_LINEAR);
+}
+
+phm_table* phm_create_table_with_engine(const char* path, int table_size, int max_assoc_bytes,
+                                        phm_engine engine) {
+  return open_or_create_and_lock_table_file(path, table_size, max_assoc_bytes, engine);
 }
 
 phm_table* phm_open_table(const char* path) {
-  return open_or_create_and_lock_table_file(path, 0, 0);
+  return open_or_create_and_lock_table_file(path, 0, 0, PHM_ENGINE_LINEAR);
+}
+
+phm_table* phm_open_table_readonly(const char* path) {
+  return open_readonly_table_file(path);
 }
 
 void phm_close_table(phm_table* table) {
+  if (phm_snapshot_step(table, SIZE_MAX) != 0) {
+    fprintf(stderr, "Could not finish snapshot before closing table.\n");
+  }
+  if (!table->readonly) {
+    close_generation(table);
+  }
+
   void* addr = (void*) table->header;
-  size_t len = calculate_len(table->header->table_size, table->header->max_assoc_bytes);
-  if (munmap(addr, len) == -1) {
+  if (munmap(addr, table->len) == -1) {
     fprintf(stderr, "Could not close table: %s\n", strerror(errno));
   }
   if (close(table->fd)  == -1) {
     fprintf(stderr, "Could not close table: %s\n", strerror(errno));
   }
 
+  free(table->dirty);
   free(table);
 }
 
+// Claims the slot for the current generation before any of it changes, so a
+// crash partway through a write always leaves it in the set recovery checks.
+// The fence keeps the compiler from sinking these stores below the rest.
+static void begin_entry_write(phm_table* table, phm_index* index) {
+  index->generation = table->header->generation;
+  index->crc = 0;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static void end_entry_write(phm_index* index, phm_assoc* assoc) {
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  index->crc = entry_crc(index, assoc);
+}
+
 static void write_assoc(phm_table* table,
                         phm_index* index,
                         size_t hash, time_t expiry,
                         const uint8_t* key, int key_size,
                         const uint8_t* value, int value_size) {
   phm_assoc* assoc = get_assoc_by_index(table, index);
+  mark_dirty(table, index, sizeof(phm_index));
+  mark_dirty(table, assoc, sizeof(phm_assoc) + key_size + value_size);
+  begin_entry_write(table, index);
   index->hash = hash;
   index->expiry = expiry;
   assoc->key_size = key_size;
   assoc->value_size = value_size;
   memcpy(assoc->bytes, key, key_size);
   memcpy(assoc->bytes + key_size, value, value_size);
+  end_entry_write(index, assoc);
 }
 
 static void update_assoc(phm_table* table,
@@ -148,9 +258,13 @@ static void update_assoc(phm_table* table,
                          time_t expiry,
                          const uint8_t* value, int value_size) {
   phm_assoc* assoc = get_assoc_by_index(table, index);
+  mark_dirty(table, index, sizeof(phm_index));
+  mark_dirty(table, assoc, sizeof(phm_assoc) + assoc->key_size + value_size);
+  begin_entry_write(table, index);
   index->expiry = expiry;
   assoc->value_size = value_size;
   memcpy(assoc->bytes + assoc->key_size, value, value_size);
+  end_entry_write(index, assoc);
 }
 
 static void append_assoc(phm_table* table,
@@ -160,30 +274,38 @@ static void append_assoc(phm_table* table,
                          const uint8_t* value, int value_size) {
   phm_header* header = table->header;
   size_t offset = header->next_free_assoc;
+  mark_dirty(table, header, sizeof(phm_header));
   header->next_free_assoc += header->max_assoc_bytes;
   index->assoc_offset = offset;
   write_assoc(table, index, hash, expiry,  key, key_size, value, value_size);
 }
 
+// Released entries (expiry 0) never match: their assoc may have been reused or
+// punched out by phm_trim.
 static bool match_key(phm_table* table, phm_index* index, size_t hash, const uint8_t* key, int key_size) {
+  if (index->expiry == 0 || index->hash != hash) {
+    return false;
+  }
   phm_assoc* assoc = get_assoc_by_index(table, index);
-  return index->hash == hash && assoc->key_size == key_size && memcmp(get_key(assoc), key, key_size) == 0;
+  return assoc->key_size == key_size && memcmp(get_key(assoc), key, key_size) == 0;
 }
 
 static bool is_empty(phm_index* index) {
   return index->expiry == 0 && index->hash == 0;
 }
 
-static void expire(phm_index* index) {
+static void expire(phm_table* table, phm_index* index) {
+  mark_dirty(table, index, sizeof(phm_index));
   index->expiry = 0;
 }
 
-static void update_expiration(phm_index* index, time_t expiry) {
+static void update_expiration(phm_table* table, phm_index* index, time_t expiry) {
   if (expiry < 0) {
     return;
   } else if (expiry == 0) {
-    expire(index);
+    expire(table, index);
   } else {
+    mark_dirty(table, index, sizeof(phm_index));
     index->expiry = expiry;
   }
 }
@@ -200,8 +322,12 @@ static void find_indices(phm_table* table,
   phm_index* lru = NULL;
   phm_index* needle = NULL;
   phm_index* last = first;
+  int probes = 0;
+
+  TRACE(find__entry, hash, key_size);
 
   do {
+    probes++;
     if (match_key(table, last, hash, key, key_size)) {
       needle = last;
       break;
@@ -227,6 +353,11 @@ static void find_indices(phm_table* table,
   *needle_p = needle;
   *last_p = last;
 
+  #define OFFSET(x) ((x) == NULL ? -1 : (x) - table->index)
+  TRACE(find__return, hash, OFFSET(needle), OFFSET(expired), OFFSET(lru), probes);
+  #undef OFFSET
+  (void) probes;
+
   assert(expired == NULL || expired != needle);
   assert(lru == NULL || lru != needle);
   assert(needle == NULL || !is_empty(needle));
@@ -234,11 +365,223 @@ static void find_indices(phm_table* table,
   assert(lru == NULL || !is_empty(lru));
 }
 
+// How many levels of cuckoo moves an insert may make before it evicts, and how
+// many alternate buckets it may read in total while searching. Only inserts
+// into two full buckets pay for the search; lookups still read two buckets.
+#define DISPLACE_DEPTH 2
+#define DISPLACE_BUCKETS 64
+
+// MurmurHash3 finalizer. The primary bucket uses the caller's hash directly, so
+// the secondary bucket is taken from a remix that depends on all of its bits.
+static size_t mix_hash(size_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
 
-int phm_put(phm_table* table,
-            size_t hash, const uint8_t* key, int key_size,
-            const uint8_t* value, int value_size,
-            time_t expiry, time_t now) {
+static size_t bucket_count(phm_table* table) {
+  return table->header->table_size / PHM_CUCKOO_BUCKET_SLOTS;
+}
+
+static phm_index* primary_bucket(phm_table* table, size_t hash) {
+  return table->index + hash % bucket_count(table) * PHM_CUCKOO_BUCKET_SLOTS;
+}
+
+static phm_index* secondary_bucket(phm_table* table, size_t hash) {
+  size_t buckets = bucket_count(table);
+  size_t first = hash % buckets;
+  size_t second = mix_hash(hash) % buckets;
+  if (second == first) {
+    second = (first + 1) % buckets;
+  }
+  return table->index + second * PHM_CUCKOO_BUCKET_SLOTS;
+}
+
+static phm_index* alternate_bucket(phm_table* table, phm_index* slot) {
+  phm_index* bucket = table->index + (slot - table->index) / PHM_CUCKOO_BUCKET_SLOTS * PHM_CUCKOO_BUCKET_SLOTS;
+  phm_index* primary = primary_bucket(table, slot->hash);
+  return bucket == primary ? secondary_bucket(table, slot->hash) : primary;
+}
+
+// The cuckoo counterpart of find_indices. Only the two candidate buckets are
+// read.
+static void find_slots(phm_table* table,
+                       size_t hash, const uint8_t* key, int key_size,
+                       phm_index** expired_p, phm_index** lru_p, phm_index** needle_p, phm_index** empty_p,
+                       time_t now) {
+  phm_index* buckets[2] = { primary_bucket(table, hash), secondary_bucket(table, hash) };
+
+  phm_index* expired = NULL;
+  phm_index* lru = NULL;
+  phm_index* needle = NULL;
+  phm_index* empty = NULL;
+
+  TRACE(find__entry, hash, key_size);
+
+  int b;
+  for (b = 0; b < 2 && needle == NULL; b++) {
+    for (phm_index* slot = buckets[b]; slot != buckets[b] + PHM_CUCKOO_BUCKET_SLOTS; slot++) {
+      if (is_empty(slot)) {
+        if (empty == NULL) {
+          empty = slot;
+        }
+        continue;
+      }
+      if (match_key(table, slot, hash, key, key_size)) {
+        needle = slot;
+        break;
+      }
+      if (expired == NULL && slot->expiry < now) {
+        expired = slot;
+      }
+      if (lru == NULL || slot->expiry < lru->expiry) {
+        lru = slot;
+      }
+    }
+  }
+
+  *expired_p = expired;
+  *lru_p = lru;
+  *needle_p = needle;
+  *empty_p = empty;
+
+  #define OFFSET(x) ((x) == NULL ? -1 : (x) - table->index)
+  // b is the number of buckets read: 1 when the key was in its primary bucket.
+  TRACE(find__return, hash, OFFSET(needle), OFFSET(expired), OFFSET(lru), b);
+  #undef OFFSET
+
+  assert(needle == NULL || !is_empty(needle));
+  assert(expired == NULL || !is_empty(expired));
+  assert(lru == NULL || !is_empty(lru));
+}
+
+// Both slots are claimed for the current generation with a zero crc before
+// either is copied, so a crash partway through leaves recovery discarding the
+// moved entries rather than keeping two live copies sharing one assoc.
+static void swap_slots(phm_table* table, phm_index* a, phm_index* b) {
+  mark_dirty(table, a, sizeof(phm_index));
+  mark_dirty(table, b, sizeof(phm_index));
+  begin_entry_write(table, a);
+  begin_entry_write(table, b);
+  phm_index tmp = *a;
+  *a = *b;
+  *b = tmp;
+  if (!is_empty(a)) {
+    end_entry_write(a, get_assoc_by_index(table, a));
+  }
+  if (!is_empty(b)) {
+    end_entry_write(b, get_assoc_by_index(table, b));
+  }
+}
+
+// Tries to free a slot in `bucket` by a chain of exactly `depth` + 1 moves,
+// each entry going to its other bucket, reading at most `*budget` alternate
+// buckets. Only index entries move; their assocs stay where they are.
+// Returns the freed slot or NULL.
+static phm_index* displace_from(phm_table* table, phm_index* bucket, int depth, int* budget, time_t now) {
+  for (phm_index* slot = bucket; slot != bucket + PHM_CUCKOO_BUCKET_SLOTS; slot++) {
+    if (*budget == 0) {
+      return NULL;
+    }
+    phm_index* alternate = alternate_bucket(table, slot);
+    phm_index* dest = NULL;
+    if (depth == 0) {
+      (*budget)--;
+      for (phm_index* d = alternate; d != alternate + PHM_CUCKOO_BUCKET_SLOTS; d++) {
+        if (is_empty(d) || d->expiry < now) {
+          dest = d;
+          break;
+        }
+      }
+    } else {
+      dest = displace_from(table, alternate, depth - 1, budget, now);
+    }
+    if (dest != NULL) {
+      LOG(" [displace %zd -> %zd]", slot - table->index, dest - table->index);
+      TRACE(put__displace, slot->hash, slot - table->index, dest - table->index);
+      swap_slots(table, slot, dest);
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+// Both candidate buckets are full of live entries. Make room by cuckoo moves,
+// shortest chains first, before falling back to evicting the lru candidate.
+// Once every slot has an assoc the table is full and evicting; a search would
+// almost always fail, so skip it.
+static phm_index* displace(phm_table* table, size_t hash, time_t now) {
+  phm_header* header = table->header;
+  if (header->next_free_assoc / header->max_assoc_bytes >= (size_t) header->table_size) {
+    return NULL;
+  }
+  phm_index* buckets[2] = { primary_bucket(table, hash), secondary_bucket(table, hash) };
+  int budget = DISPLACE_BUCKETS;
+  for (int depth = 0; depth <= DISPLACE_DEPTH; depth++) {
+    for (int b = 0; b < 2; b++) {
+      phm_index* slot = displace_from(table, buckets[b], depth, &budget, now);
+      if (slot != NULL) {
+        return slot;
+      }
+    }
+  }
+  return NULL;
+}
+
+static int put_cuckoo(phm_table* table,
+                      size_t hash, const uint8_t* key, int key_size,
+                      const uint8_t* value, int value_size,
+                      time_t expiry, time_t now) {
+  phm_index* expired;
+  phm_index* lru;
+  phm_index* needle;
+  phm_index* empty;
+  find_slots(table, hash, key, key_size, &expired, &lru, &needle, &empty, now);
+
+  #define OFFSET(x) ((x) == NULL ? -1 : (x) - table->index)
+  LOG("needle = %zd, expired = %zd, lru = %zd, empty = %zd, ",
+    OFFSET(needle), OFFSET(expired), OFFSET(lru), OFFSET(empty));
+  #undef OFFSET
+
+  if (needle != NULL) {
+    LOG(" [update]\n");
+    TRACE(put__update, hash, needle - table->index);
+    update_assoc(table, needle, expiry, value, value_size);
+    return 1;
+  }
+
+  phm_index* slot = expired != NULL ? expired : empty;
+  if (slot == NULL) {
+    slot = displace(table, hash, now);
+  }
+
+  if (slot != NULL && is_empty(slot)) {
+    LOG(" [append]\n");
+    TRACE(put__append, hash, slot - table->index);
+    append_assoc(table, slot, hash, expiry, key, key_size, value, value_size);
+  } else if (slot != NULL) {
+    LOG(" [write expired (%zu)]\n", slot->hash);
+    TRACE(put__expired, hash, slot->hash, slot - table->index);
+    table->stats.expiration++;
+    write_assoc(table, slot, hash, expiry, key, key_size, value, value_size);
+  } else {
+    LOG(" [write lru (%zu)]\n", lru->hash);
+    TRACE(put__lru, hash, lru->hash, lru - table->index);
+    table->stats.eviction++;
+    write_assoc(table, lru, hash, expiry, key, key_size, value, value_size);
+  }
+  return 0;
+}
+
+static int put(phm_table* table,
+              size_t hash, const uint8_t* key, int key_size,
+              const uint8_t* value, int value_size,
+              time_t expiry, time_t now) {
+  if (table->readonly) {
+    fprintf(stderr, "Cannot put into a table opened read-only.\n");
+    return -1;
+  }
   if (hash == 0) {
     // hash of 0 is reserved for denoting free entries.
     hash = hash + 1;
@@ -249,6 +592,10 @@ int phm_put(phm_table* table,
     return -1;
   }
 
+  if (table->header->engine == PHM_ENGINE_CUCKOO) {
+    return put_cuckoo(table, hash, key, key_size, value, value_size, expiry, now);
+  }
+
   phm_index* expired;
   phm_index* lru;
   phm_index* needle;
@@ -263,35 +610,78 @@ int phm_put(phm_table* table,
   if (needle == NULL) {
     if (expired != NULL) {
       LOG(" [write expired (%zu)]\n", expired->hash);
+      TRACE(put__expired, hash, expired->hash, expired - table->index);
+      table->stats.expiration++;
       write_assoc(table, expired, hash, expiry, key, key_size, value, value_size);
     } else if (is_empty(last)) {
       LOG(" [append]\n");
+      TRACE(put__append, hash, last - table->index);
       append_assoc(table, last, hash, expiry, key, key_size, value, value_size);
     } else {
       LOG(" [write lru (%zu)]\n", lru->hash);
+      TRACE(put__lru, hash, lru->hash, lru - table->index);
+      table->stats.eviction++;
       write_assoc(table, lru, hash, expiry, key, key_size, value, value_size);
     }
     return 0;
   } else {
     if (expired != NULL) {
       LOG(" [write expired compact (%zu)]\n", expired->hash);
-      expire(needle);
+      TRACE(put__compact, hash, expired->hash, needle - table->index, expired - table->index);
+      table->stats.expiration++;
+      expire(table, needle);
       write_assoc(table, expired, hash, expiry, key, key_size, value, value_size);
     } else {
       LOG(" [update]\n");
+      TRACE(put__update, hash, needle - table->index);
       update_assoc(table, needle, expiry, value, value_size);
     }
     return 1;
   }
 }
 
-int phm_get(phm_table* table,
+int phm_put(phm_table* table,
             size_t hash, const uint8_t* key, int key_size,
-            const uint8_t** value,
-            time_t new_expiry) {
+            const uint8_t* value, int value_size,
+            time_t expiry, time_t now) {
+  uint64_t start = sample_latency(table) ? monotonic_ns() : 0;
+  int ret = put(table, hash, key, key_size, value, value_size, expiry, now);
+  if (!table->in_batch && sync_table(table, false) != 0) {
+    ret = -1;
+  }
+  if (start != 0) {
+    record_latency(table, PHM_OP_PUT, monotonic_ns() - start);
+  }
+  return ret;
+}
+
+#define READONLY_GET_ATTEMPTS 3
+
+// A read-only handle takes no lock, so it can see an entry while the writer is
+// still changing it. The writer clears the crc before touching an entry and
+// sets it last, so an entry whose crc matches its bytes was whole when read.
+static bool is_whole_entry(phm_table* table, phm_index* index, phm_assoc* assoc) {
+  uint32_t crc = __atomic_load_n(&index->crc, __ATOMIC_ACQUIRE);
+  int max = table->header->max_assoc_bytes;
+  if (assoc->key_size < 0 || assoc->key_size > max ||
+      assoc->value_size < 0 || assoc->value_size > max - assoc->key_size) {
+    return false;
+  }
+  return crc == entry_crc(index, assoc);
+}
+
+static int get(phm_table* table,
+               size_t hash, const uint8_t* key, int key_size,
+               const uint8_t** value,
+               time_t new_expiry) {
   if (hash == 0) {
     hash = hash + 1;
   }
+  if (table->readonly && new_expiry >= 0) {
+    fprintf(stderr, "Cannot update expiry in a table opened read-only.\n");
+    *value = NULL;
+    return -1;
+  }
   if (key_size > table->header->max_assoc_bytes) {
     fprintf(stderr, "Key size %d greater than max assoc bytes %d.\n",
           key_size, table->header->max_assoc_bytes);
@@ -303,20 +693,67 @@ int phm_get(phm_table* table,
   phm_index* lru;
   phm_index* needle;
   phm_index* last;
-  find_indices(table, hash, key, key_size, &expired, &lru, &needle,  &last, 0);
+  phm_assoc* assoc = NULL;
+  for (int attempt = 0; ; attempt++) {
+    if (table->header->engine == PHM_ENGINE_CUCKOO) {
+      find_slots(table, hash, key, key_size, &expired, &lru, &needle, &last, 0);
+    } else {
+      find_indices(table, hash, key, key_size, &expired, &lru, &needle,  &last, 0);
+    }
+    if (needle == NULL) {
+      break;
+    }
+    assoc = get_assoc_by_index(table, needle);
+    if (!table->readonly || is_whole_entry(table, needle, assoc)) {
+      break;
+    }
+    // Caught the writer halfway through this entry; look again, since it may
+    // have moved or finished by now.
+    if (attempt + 1 == READONLY_GET_ATTEMPTS) {
+      needle = NULL;
+      break;
+    }
+  }
 
   if (needle == NULL) {
+    table->stats.cache_miss++;
     *value = NULL;
     return -1;
   }
 
-  update_expiration(needle, new_expiry);
+  table->stats.cache_hit++;
+  update_expiration(table, needle, new_expiry);
 
-  phm_assoc* assoc = get_assoc_by_index(table, needle);
   *value = get_value(assoc);
   return assoc->value_size;
 }
 
+int phm_get(phm_table* table,
+            size_t hash, const uint8_t* key, int key_size,
+            const uint8_t** value,
+            time_t new_expiry) {
+  uint64_t start = sample_latency(table) ? monotonic_ns() : 0;
+  int ret = get(table, hash, key, key_size, value, new_expiry);
+  if (!table->in_batch) {
+    sync_table(table, false);
+  }
+  if (start != 0) {
+    record_latency(table, PHM_OP_GET, monotonic_ns() - start);
+  }
+  return ret;
+}
+
+int phm_peek(phm_table* table,
+             size_t hash, const uint8_t* key, int key_size,
+             const uint8_t** value) {
+  uint64_t start = sample_latency(table) ? monotonic_ns() : 0;
+  int ret = get(table, hash, key, key_size, value, -1);
+  if (start != 0) {
+    record_latency(table, PHM_OP_GET, monotonic_ns() - start);
+  }
+  return ret;
+}
+
 int phm_get_table_size(phm_table* table) {
   return table->header->table_size;
 }
@@ -324,3 +761,7 @@ int phm_get_table_size(phm_table* table) {
 int phm_get_max_assoc_bytes(phm_table* table) {
   return table->header->max_assoc_bytes;
 }
+
+phm_engine phm_get_engine(phm_table* table) {
+  return (phm_engine) table->header->engine;
+}
@@ -4,22 +4,48 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <time.h>
 
 typedef struct phm_table phm_table;
 
+typedef enum {
+  // Linear probing from hash % table_size. Lookups walk the whole cluster.
+  PHM_ENGINE_LINEAR,
+  // Bucketized cuckoo hashing: every key has two candidate buckets of
+  // PHM_CUCKOO_BUCKET_SLOTS entries, so a lookup reads at most two buckets.
+  PHM_ENGINE_CUCKOO
+} phm_engine;
+
+#define PHM_CUCKOO_BUCKET_SLOTS 4
+
 phm_table* phm_create_table(const char* path,
                             int table_size,
                             int max_assoc_bytes);
 
+phm_table* phm_create_table_with_engine(const char* path,
+                                        int table_size,
+                                        int max_assoc_bytes,
+                                        phm_engine engine);
+
 phm_table* phm_open_table(const char* path);
 
+// Maps the table PROT_READ without taking the file lock, so any number of
+// readers can run alongside the process that has it open for writing. Gets on
+// a read-only handle check the entry's crc and retry a few times if they catch
+// the writer mid-write, then report a miss, so a hit was whole when it was
+// read. The value still points into the shared mapping, and a later write can
+// replace it underneath the reader.
+phm_table* phm_open_table_readonly(const char* path);
+
 void phm_close_table(phm_table* table);
 
 int phm_get_table_size(phm_table* table);
 
 int phm_get_max_assoc_bytes(phm_table* table);
 
+phm_engine phm_get_engine(phm_table* table);
+
 int phm_put(phm_table* table,
             size_t hash, const uint8_t* key, int key_size,
             const uint8_t* value, int value_size,
@@ -30,4 +56,55 @@ int phm_get(phm_table* table,
             const uint8_t** value,
             time_t new_expiry);
 
+// Like phm_get with new_expiry = -1: never writes to the table, so it is safe
+// on read-only handles.
+int phm_peek(phm_table* table,
+             size_t hash, const uint8_t* key, int key_size,
+             const uint8_t** value);
+
+typedef enum {
+  PHM_DURABILITY_NONE,      // leave writeback to the kernel (default)
+  PHM_DURABILITY_PERIODIC,  // msync dirty pages on commit once `interval` seconds have passed
+  PHM_DURABILITY_SYNC       // msync dirty pages on every commit
+} phm_durability;
+
+int phm_set_durability(phm_table* table, phm_durability durability, int interval);
+
+// Outside a batch every put/get commits on its own. Inside a batch the dirty
+// pages accumulate and are flushed once by phm_commit_batch.
+void phm_begin_batch(phm_table* table);
+
+int phm_commit_batch(phm_table* table);
+
+// Flushes the dirty pages now, ignoring the periodic interval. Call it from a
+// timer so an idle process still bounds how much it can lose.
+int phm_sync(phm_table* table);
+
+// Flushes the whole table and starts a new generation. After a crash only
+// entries written since the last checkpoint are verified on open.
+int phm_checkpoint(phm_table* table);
+
+// Releases every entry that expired before `now` and punches holes over the
+// assoc pages no remaining entry uses, so disk and page cache usage follow the
+// live data. Meant to run periodically, e.g. after a burst of evictions.
+// Returns the number of bytes newly released by this call, or -1.
+ssize_t phm_trim(phm_table* table, time_t now);
+
+// Online snapshots. phm_snapshot_begin captures the table as it is between two
+// operations: from then on, before a put or get modifies a region that has not
+// been copied yet, the old contents are written to dest_path first. Call
+// phm_snapshot_step from the serving loop to copy up to max_bytes of the rest;
+// it returns 1 while there is more to do, 0 once the snapshot is complete and
+// -1 on error (the partial file is removed).
+int phm_snapshot_begin(phm_table* table, const char* dest_path);
+
+int phm_snapshot_step(phm_table* table, size_t max_bytes);
+
+void phm_snapshot_abort(phm_table* table);
+
+// Reflinks the file when the filesystem supports FICLONE; otherwise runs a
+// snapshot to completion on the calling thread at up to bytes_per_sec
+// (0 = unthrottled).
+int phm_snapshot(phm_table* table, const char* dest_path, size_t bytes_per_sec);
+
 #endif
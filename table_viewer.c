@@ -8,8 +8,11 @@
 static void print_header(phm_table* table) {
   phm_header* header = table->header;
 
-  printf("HEADER: table size = %d, max assoc bytes = %d, next free assoc = %zu\n",
-    header->table_size, header->max_assoc_bytes, header->next_free_assoc);
+  printf("HEADER: table size = %d, max assoc bytes = %d, next free assoc = %zu, "
+         "generation = %u, clean shutdown = %u, engine = %s\n",
+    header->table_size, header->max_assoc_bytes, header->next_free_assoc,
+    header->generation, header->clean_shutdown,
+    header->engine == PHM_ENGINE_CUCKOO ? "cuckoo" : "linear");
 }
 
 static void print_value(phm_table* table, phm_iterator iterator) {
@@ -37,7 +40,7 @@ int main(int argc, char* argv[]) {
     }
     const char* table_path = argv[1];
 
-    phm_table* table = phm_open_table(table_path);
+    phm_table* table = phm_open_table_readonly(table_path);
     if (table == NULL) {
         exit(1);
     }
@@ -1,10 +1,17 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #include "table.h"
 #include "iterator.h"
+#include "stats.h"
+#include "crc32c.h"
+#include "internal.h"
+#include "sharded.h"
 
 static char PATH[128];
 
@@ -143,6 +150,603 @@ static void test_stress() {
     remove(PATH);
 }
 
+static void test_stats() {
+    phm_table* table = phm_create_table(PATH, 4, 32);
+    assert(table != NULL);
+    phm_set_latency_sampling(table, 2);
+
+    insert(table, 1, "a", "va", 10, 1);
+    insert(table, 1, "b", "vb", 2, 1);
+    insert(table, 1, "c", "vc", 10, 3);   // overwrites expired "b"
+    insert(table, 1, "d", "vd", 10, 3);
+    insert(table, 1, "e", "ve", 10, 3);
+    insert(table, 1, "f", "vf", 10, 3);   // table full, evicts lru
+    check_get(table, 1, "c", "vc", -1);
+    check_get(table, 1, "x", NULL, -1);
+
+    phm_stats stats;
+    phm_get_stats(table, &stats);
+    assert(stats.cache_hit == 1);
+    assert(stats.cache_miss == 1);
+    assert(stats.expiration == 1);
+    assert(stats.eviction == 1);
+
+    const phm_latency_histogram* puts = phm_get_latency_histogram(table, PHM_OP_PUT);
+    const phm_latency_histogram* gets = phm_get_latency_histogram(table, PHM_OP_GET);
+    assert(puts->samples + gets->samples == 4);
+    size_t total = 0;
+    for (int i = 0; i < PHM_LATENCY_BUCKETS; i++) {
+        total += puts->buckets[i] + gets->buckets[i];
+    }
+    assert(total == 4);
+
+    for (int i = 0; i + 1 < PHM_LATENCY_BUCKETS; i++) {
+        assert(phm_latency_bucket_floor(i) < phm_latency_bucket_floor(i + 1));
+    }
+
+    phm_reset_latency_histograms(table);
+    assert(puts->samples == 0);
+
+    phm_close_table(table);
+    remove(PATH);
+}
+
+static bool has_dirty_pages(phm_table* table) {
+    size_t pages = (table->len + page_size() - 1) / page_size();
+    bool any_bit = false;
+    for (size_t word = 0; word < (pages + 63) / 64; word++) {
+        any_bit = any_bit || table->dirty[word] != 0;
+    }
+    bool in_range = table->dirty_lo < table->dirty_hi;
+    assert(any_bit == in_range);
+    if (!in_range) {
+        assert(table->dirty_lo == SIZE_MAX && table->dirty_hi == 0);
+    }
+    return in_range;
+}
+
+static void test_batch() {
+    phm_table* table = phm_create_table(PATH, 1000, 64);
+    assert(table != NULL);
+    assert(phm_set_durability(table, PHM_DURABILITY_SYNC, 0) == 0);
+
+    assert(!has_dirty_pages(table));
+
+    // Outside a batch a SYNC put flushes before it returns.
+    insert(table, 7, "unbatched", "v", 10, 1);
+    assert(!has_dirty_pages(table));
+
+    char key[32];
+    phm_begin_batch(table);
+    for (int i = 0; i < 500; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        insert(table, i * 7919, key, key, 10, 1);
+        assert(has_dirty_pages(table));
+    }
+    assert(phm_commit_batch(table) == 0);
+    assert(!has_dirty_pages(table));
+
+    // PERIODIC leaves pages dirty until the interval passes or phm_sync.
+    assert(phm_set_durability(table, PHM_DURABILITY_PERIODIC, 60) == 0);
+    insert(table, 8, "periodic", "v", 10, 1);
+    assert(has_dirty_pages(table));
+    assert(phm_commit_batch(table) == 0);
+    assert(has_dirty_pages(table));
+    assert(phm_sync(table) == 0);
+    assert(!has_dirty_pages(table));
+
+    assert(phm_set_durability(table, PHM_DURABILITY_PERIODIC, 0) == 0);
+    insert(table, 9, "elapsed", "v", 10, 1);
+    assert(!has_dirty_pages(table));
+
+    phm_close_table(table);
+    table = phm_open_table(PATH);
+    assert(table != NULL);
+    check_get(table, 7, "unbatched", "v", -1);
+    check_get(table, 8, "periodic", "v", -1);
+    check_get(table, 9, "elapsed", "v", -1);
+    for (int i = 0; i < 500; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        check_get(table, i * 7919, key, key, -1);
+    }
+
+    phm_close_table(table);
+    remove(PATH);
+}
+
+static void test_crc32c() {
+    assert(crc32c(0, "123456789", 9) == 0xe3069283);
+    assert(crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xe3069283);
+}
+
+static void test_recovery() {
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        phm_table* table = phm_create_table(PATH, 10, 32);
+        insert(table, 1, "old", "v", 10, 1);
+        phm_checkpoint(table);
+        insert(table, 2, "new", "v", 10, 1);
+        insert(table, 3, "torn", "v", 10, 1);
+        // Simulate dying halfway through write_assoc.
+        phm_index* index = table->index + 3;
+        get_value(get_assoc_by_index(table, index))[0] = 'x';
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    phm_table* table = phm_open_table(PATH);
+    assert(table != NULL);
+    check_get(table, 1, "old", "v", -1);
+    check_get(table, 2, "new", "v", -1);
+    check_get(table, 3, "torn", NULL, -1);
+    phm_close_table(table);
+
+    table = phm_open_table(PATH);
+    assert(table != NULL);
+    check_get(table, 2, "new", "v", -1);
+    phm_close_table(table);
+    remove(PATH);
+}
+
+static void test_recovery_partial_write() {
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        phm_table* table = phm_create_table(PATH, 10, 32);
+        insert(table, 1, "old", "v", 10, 1);
+        phm_checkpoint(table);
+        // Die halfway through appending "fresh": the slot is claimed and its
+        // sizes are set, but only part of the value is copied and no crc yet.
+        phm_index* index = table->index + 5;
+        index->assoc_offset = table->header->next_free_assoc;
+        table->header->next_free_assoc += table->header->max_assoc_bytes;
+        index->generation = table->header->generation;
+        index->crc = 0;
+        index->hash = 5;
+        index->expiry = 10;
+        phm_assoc* assoc = get_assoc_by_index(table, index);
+        assoc->key_size = 5;
+        assoc->value_size = 20;
+        memcpy(assoc->bytes, "fresh", 5);
+        memcpy(assoc->bytes + 5, "0123456789", 10);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    phm_table* table = phm_open_table(PATH);
+    assert(table != NULL);
+    check_get(table, 1, "old", "v", -1);
+    check_get(table, 5, "fresh", NULL, -1);
+    phm_close_table(table);
+    remove(PATH);
+}
+
+static void test_recovery_keeps_probe_chain() {
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        phm_table* table = phm_create_table(PATH, 10, 32);
+        insert(table, 1, "a", "va", 10, 1);
+        insert(table, 1, "b", "vb", 10, 1);
+        insert(table, 1, "c", "vc", 10, 1);
+        // "b" sits between "a" and "c" in the chain; tear it, including its
+        // assoc offset.
+        table->index[2].assoc_offset = 12345;
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    phm_table* table = phm_open_table(PATH);
+    assert(table != NULL);
+    check_get(table, 1, "a", "va", -1);
+    check_get(table, 1, "b", NULL, -1);
+    check_get(table, 1, "c", "vc", -1);
+
+    // Putting "c" again updates it in place rather than adding a duplicate,
+    // and "d" reuses the released slot through a sound assoc.
+    insert(table, 1, "c", "vc2", 10, 2);
+    insert(table, 1, "d", "vd", 10, 2);
+    check_get(table, 1, "a", "va", -1);
+    check_get(table, 1, "c", "vc2", -1);
+    check_get(table, 1, "d", "vd", -1);
+    int count = 0;
+    for (phm_iterator it = phm_iterator_begin(table); it != phm_iterator_end(table);
+         it = phm_iterator_advance(table, it)) {
+        count++;
+    }
+    assert(count == 3);
+
+    phm_close_table(table);
+    remove(PATH);
+}
+
+static void test_reject_foreign_file() {
+    // A table written by the original layout: 16-byte header, 24-byte index
+    // entries and no magic number.
+    uint8_t old[16 + 24 * 10 + 40 * 10] = { 0 };
+    int table_size = 10;
+    int max_assoc_bytes = 32;
+    memcpy(old, &table_size, sizeof(int));
+    memcpy(old + sizeof(int), &max_assoc_bytes, sizeof(int));
+    old[16] = 1;
+    FILE* f = fopen(PATH, "w");
+    assert(f != NULL);
+    assert(fwrite(old, sizeof(old), 1, f) == 1);
+    fclose(f);
+
+    assert(phm_open_table(PATH) == NULL);
+    assert(phm_open_table_readonly(PATH) == NULL);
+
+    uint8_t after[sizeof(old)];
+    f = fopen(PATH, "r");
+    assert(fread(after, sizeof(after), 1, f) == 1);
+    fclose(f);
+    assert(memcmp(old, after, sizeof(old)) == 0);
+    remove(PATH);
+}
+
+static void test_readonly() {
+    phm_table* writer = phm_create_table(PATH, 10, 32);
+    assert(writer != NULL);
+    insert(writer, 1, "a", "va", 10, 1);
+
+    phm_table* reader = phm_open_table_readonly(PATH);
+    assert(reader != NULL);
+    assert(phm_get_table_size(reader) == 10);
+
+    const uint8_t* value_out;
+    assert(phm_peek(reader, 1, (uint8_t*) "a", 1, &value_out) == 2);
+    assert(memcmp(value_out, "va", 2) == 0);
+
+    // Writes through the writer are visible to the reader straight away.
+    insert(writer, 2, "b", "vb", 10, 1);
+    assert(phm_peek(reader, 2, (uint8_t*) "b", 1, &value_out) == 2);
+    check_get(reader, 2, "b", "vb", -1);
+
+    // An entry the writer has not finished does not match its crc, so the
+    // reader reports a miss rather than returning it.
+    uint32_t crc = writer->index[1].crc;
+    writer->index[1].crc = 0;
+    check_get(reader, 1, "a", NULL, -1);
+    writer->index[1].crc = crc;
+    check_get(reader, 1, "a", "va", -1);
+
+    assert(phm_put(reader, 3, (uint8_t*) "c", 1, (uint8_t*) "vc", 2, 10, 1) == -1);
+    check_get(reader, 1, "a", NULL, 0);
+    check_get(writer, 1, "a", "va", -1);
+
+    phm_close_table(reader);
+    phm_close_table(writer);
+    remove(PATH);
+
+    assert(phm_open_table_readonly(PATH) == NULL);
+}
+
+static void test_cuckoo() {
+    phm_table* table = phm_create_table_with_engine(PATH, 10, 32, PHM_ENGINE_CUCKOO);
+    assert(table != NULL);
+    assert(phm_get_engine(table) == PHM_ENGINE_CUCKOO);
+    assert(phm_get_table_size(table) == 12);
+
+    insert(table, 3, "a", "va", 10, 1);
+    insert(table, 3, "b", "vb", 10, 1);
+    insert(table, 3, "a", "va2", 10, 1);
+    check_get(table, 3, "a", "va2", -1);
+    check_get(table, 3, "b", "vb", 0);
+    check_get(table, 3, "b", NULL, -1);   // released entries never match
+    insert(table, 3, "c", "vc", 10, 1);   // reuses b's slot and assoc
+
+    int count = 0;
+    for (phm_iterator it = phm_iterator_begin(table); it != phm_iterator_end(table);
+         it = phm_iterator_advance(table, it)) {
+        count++;
+    }
+    assert(count == 2);
+    phm_close_table(table);
+    remove(PATH);
+
+    // At 90% load every key still fits in one of its two buckets.
+    table = phm_create_table_with_engine(PATH, 10000, 64, PHM_ENGINE_CUCKOO);
+    assert(table != NULL);
+    char key[64];
+    long long hash = 0;
+    for (int i = 0; i < 9000; i++) {
+        hash = (hash * 63 + ~i) ^ ~hash;
+        snprintf(key, sizeof(key), "key=%lld", hash);
+        insert(table, (size_t) hash, key, key, 10, 5);
+    }
+    phm_stats stats;
+    phm_get_stats(table, &stats);
+    assert(stats.eviction == 0);
+
+    phm_close_table(table);
+    table = phm_open_table(PATH);
+    assert(phm_get_engine(table) == PHM_ENGINE_CUCKOO);
+    hash = 0;
+    for (int i = 0; i < 9000; i++) {
+        hash = (hash * 63 + ~i) ^ ~hash;
+        snprintf(key, sizeof(key), "key=%lld", hash);
+        check_get(table, (size_t) hash, key, key, -1);
+    }
+
+    // A full table evicts the lru candidate rather than failing.
+    for (int i = 0; i < 2000; i++) {
+        snprintf(key, sizeof(key), "extra=%d", i);
+        insert(table, (size_t) i * 2654435761u, key, key, 20, 5);
+    }
+    phm_get_stats(table, &stats);
+    assert(stats.eviction > 0);
+
+    phm_close_table(table);
+    remove(PATH);
+
+    // Entries moved by displacement survive a crash exactly once.
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        table = phm_create_table_with_engine(PATH, 10000, 64, PHM_ENGINE_CUCKOO);
+        hash = 0;
+        for (int i = 0; i < 9000; i++) {
+            hash = (hash * 63 + ~i) ^ ~hash;
+            snprintf(key, sizeof(key), "key=%lld", hash);
+            insert(table, (size_t) hash, key, key, 10, 5);
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    table = phm_open_table(PATH);
+    assert(table != NULL);
+    hash = 0;
+    for (int i = 0; i < 9000; i++) {
+        hash = (hash * 63 + ~i) ^ ~hash;
+        snprintf(key, sizeof(key), "key=%lld", hash);
+        check_get(table, (size_t) hash, key, key, -1);
+    }
+    count = 0;
+    for (phm_iterator it = phm_iterator_begin(table); it != phm_iterator_end(table);
+         it = phm_iterator_advance(table, it)) {
+        count++;
+    }
+    assert(count == 9000);
+    phm_close_table(table);
+    remove(PATH);
+}
+
+static void test_snapshot() {
+    char snapshot_path[sizeof(PATH) + 16];
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.snapshot", PATH);
+
+    phm_table* table = phm_create_table(PATH, 20000, 64);
+    assert(table != NULL);
+    char key[32];
+    for (int i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        insert(table, i, key, "before", 10, 1);
+    }
+
+    assert(phm_snapshot_begin(table, snapshot_path) == 0);
+    assert(phm_snapshot_begin(table, snapshot_path) == -1);
+    int steps = 0;
+    int ret;
+    for (int i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        insert(table, i, key, "after", 10, 1);
+        snprintf(key, sizeof(key), "new=%d", i);
+        insert(table, i + 10000, key, "after", 10, 1);
+        if (i % 100 == 0 && (ret = phm_snapshot_step(table, 64 * 1024)) == 1) {
+            steps++;
+        }
+    }
+    assert(steps > 1);
+    while ((ret = phm_snapshot_step(table, 64 * 1024)) == 1) {
+    }
+    assert(ret == 0);
+
+    phm_table* copy = phm_open_table_readonly(snapshot_path);
+    assert(copy != NULL);
+    for (int i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        check_get(copy, i, key, "before", -1);
+        snprintf(key, sizeof(key), "new=%d", i);
+        check_get(copy, i + 10000, key, NULL, -1);
+    }
+    phm_close_table(copy);
+    remove(snapshot_path);
+
+    assert(phm_snapshot(table, snapshot_path, 0) == 0);
+    phm_close_table(table);
+    table = phm_open_table(snapshot_path);
+    assert(table != NULL);
+    check_get(table, 7, "key=7", "after", -1);
+    check_get(table, 10007, "new=7", "after", -1);
+    phm_close_table(table);
+    remove(snapshot_path);
+    remove(PATH);
+
+    // Only live data counts against the budget: a large, nearly empty table
+    // finishes in one small step.
+    table = phm_create_table(PATH, 16000, 4096);
+    assert(table != NULL);
+    insert(table, 1, "only", "entry", 10, 1);
+    assert(phm_snapshot_begin(table, snapshot_path) == 0);
+    assert(phm_snapshot_step(table, 1024 * 1024) == 0);
+    phm_close_table(table);
+    table = phm_open_table_readonly(snapshot_path);
+    assert(table != NULL);
+    check_get(table, 1, "only", "entry", -1);
+    phm_close_table(table);
+    remove(snapshot_path);
+    remove(PATH);
+
+    // A rate below ten bytes a second still makes progress.
+    table = phm_create_table(PATH, 10, 32);
+    assert(table != NULL);
+    insert(table, 1, "a", "va", 10, 1);
+    assert(phm_snapshot(table, snapshot_path, 5) == 0);
+    phm_close_table(table);
+    remove(snapshot_path);
+    remove(PATH);
+
+    // The copy is paced by bytes written: at 640KB/s the second 64KB chunk is
+    // not due for 100ms. A reflink skips the copy and finishes at once.
+    table = phm_create_table(PATH, 1000, 64);
+    assert(table != NULL);
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        insert(table, i, key, "value", 10, 1);
+    }
+    uint64_t start = monotonic_ns();
+    assert(phm_snapshot(table, snapshot_path, 640 * 1024) == 0);
+    uint64_t elapsed = monotonic_ns() - start;
+    assert(elapsed < 10 * 1000 * 1000 || elapsed >= 95 * 1000 * 1000);
+    phm_close_table(table);
+    table = phm_open_table_readonly(snapshot_path);
+    assert(table != NULL);
+    check_get(table, 999, "key=999", "value", -1);
+    phm_close_table(table);
+    remove(snapshot_path);
+    remove(PATH);
+}
+
+static void test_trim() {
+    phm_table* table = phm_create_table(PATH, 1000, 4096);
+    assert(table != NULL);
+    char key[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        insert(table, i, key, "value", i < 500 ? 5 : 20, 1);
+    }
+
+    phm_footprint before;
+    assert(phm_get_footprint(table, &before) == 0);
+    assert(before.logical_bytes > 1000 * 4096);
+
+    ssize_t released = phm_trim(table, 10);
+    assert(released >= 400 * 4096);
+
+    phm_footprint after;
+    assert(phm_get_footprint(table, &after) == 0);
+    assert(after.logical_bytes == before.logical_bytes);
+    assert(after.allocated_bytes + released <= before.allocated_bytes + 4096);
+
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        check_get(table, i, key, i < 500 ? NULL : "value", -1);
+    }
+    // Nothing new to release; holes punched earlier are not counted again.
+    assert(phm_trim(table, 10) == 0);
+    check_get(table, 3, "", NULL, -1);
+
+    // Released slots are reused by later puts.
+    insert(table, 3, "key=3", "again", 20, 11);
+    check_get(table, 3, "key=3", "again", -1);
+
+    phm_close_table(table);
+    remove(PATH);
+}
+
+static void test_sharded() {
+    phm_sharded_table* sharded = phm_sharded_create(PATH, 4, 1000, 32, PHM_ENGINE_CUCKOO);
+    assert(sharded != NULL);
+    assert(phm_sharded_get_shard_count(sharded) == 4);
+    // Bind to a cpu we are allowed on, and put the mask back afterwards.
+    cpu_set_t allowed;
+    assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed)) {
+        cpu++;
+    }
+    assert(phm_sharded_bind_shard(sharded, 2, cpu) == 0);
+    assert(phm_sharded_get_shard_cpu(sharded, 2) == cpu);
+    assert(phm_sharded_get_shard_cpu(sharded, 1) == -1);
+    assert(sched_setaffinity(0, sizeof(allowed), &allowed) == 0);
+
+    char key[32];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        size_t hash = (size_t) i * 0x9e3779b97f4a7c15ULL;
+        assert(phm_sharded_put(sharded, hash, (uint8_t*) key, strlen(key),
+                               (uint8_t*) key, strlen(key), 10, 1) == 0);
+    }
+    for (int shard = 0; shard < 4; shard++) {
+        phm_stats stats;
+        phm_get_stats(phm_sharded_get_shard(sharded, shard), &stats);
+        assert(stats.eviction == 0);
+    }
+    phm_sharded_close(sharded);
+
+    sharded = phm_sharded_open(PATH);
+    assert(sharded != NULL);
+    const uint8_t* value_out;
+    for (int i = 0; i < 2000; i++) {
+        snprintf(key, sizeof(key), "key=%d", i);
+        size_t hash = (size_t) i * 0x9e3779b97f4a7c15ULL;
+        assert(phm_sharded_get(sharded, hash, (uint8_t*) key, strlen(key), &value_out, -1)
+               == (int) strlen(key));
+        assert(memcmp(value_out, key, strlen(key)) == 0);
+    }
+    phm_stats stats;
+    phm_sharded_get_stats(sharded, &stats);
+    assert(stats.cache_hit == 2000);
+
+    int count = 0;
+    int per_shard[4] = { 0 };
+    for (phm_sharded_iterator it = phm_sharded_iterator_begin(sharded);
+         !phm_sharded_iterator_done(sharded, it);
+         it = phm_sharded_iterator_advance(sharded, it)) {
+        phm_table* shard = phm_sharded_get_shard(sharded, it.shard);
+        assert(phm_sharded_shard_of(sharded, phm_iterator_hash(shard, it.iterator)) == it.shard);
+        per_shard[it.shard]++;
+        count++;
+    }
+    assert(count == 2000);
+    for (int shard = 0; shard < 4; shard++) {
+        assert(per_shard[shard] > 0);
+    }
+    phm_sharded_close(sharded);
+
+    // Swapped or missing shard files are rejected, not silently misrouted.
+    char buf[sizeof(PATH) + 16];
+    char other[sizeof(PATH) + 16];
+    char swap[sizeof(PATH) + 16];
+    snprintf(buf, sizeof(buf), "%s.1", PATH);
+    snprintf(other, sizeof(other), "%s.2", PATH);
+    snprintf(swap, sizeof(swap), "%s.swap", PATH);
+    assert(rename(buf, swap) == 0);
+    assert(rename(other, buf) == 0);
+    assert(rename(swap, other) == 0);
+    assert(phm_sharded_open(PATH) == NULL);
+    assert(phm_sharded_open_readonly(PATH) == NULL);
+
+    snprintf(buf, sizeof(buf), "%s.3", PATH);
+    remove(buf);
+    assert(phm_sharded_open(PATH) == NULL);
+
+    for (int shard = 0; shard < 4; shard++) {
+        snprintf(buf, sizeof(buf), "%s.%d", PATH, shard);
+        remove(buf);
+    }
+    assert(phm_sharded_open(PATH) == NULL);
+
+    // A standalone table is not a shard set.
+    snprintf(buf, sizeof(buf), "%s.0", PATH);
+    phm_table* table = phm_create_table(buf, 10, 32);
+    assert(table != NULL);
+    phm_close_table(table);
+    assert(phm_sharded_open(PATH) == NULL);
+    remove(buf);
+}
+
 #define TEST(fn) do {             \
     printf("TESTING " # fn "\n"); \
     test_ ## fn ();               \
@@ -157,6 +761,18 @@ int main() {
     TEST(header);
     TEST(insert);
     TEST(stress);
+    TEST(stats);
+    TEST(batch);
+    TEST(crc32c);
+    TEST(recovery);
+    TEST(recovery_partial_write);
+    TEST(recovery_keeps_probe_chain);
+    TEST(reject_foreign_file);
+    TEST(readonly);
+    TEST(cuckoo);
+    TEST(snapshot);
+    TEST(trim);
+    TEST(sharded);
 
     printf("\n\nAll tests passed!\n\n");
     return 0;